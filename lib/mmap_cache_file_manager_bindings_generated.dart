@@ -141,7 +141,7 @@ class MmapCacheFileManagerBindings {
   late final _getContentTotalLength = _getContentTotalLengthPtr
       .asFunction<int Function(ffi.Pointer<ffi.Void>)>();
 
-  void flushToTargetFile(
+  int flushToTargetFile(
     ffi.Pointer<ffi.Void> mmapFilePtr,
     ffi.Pointer<ffi.Char> filePath,
   ) {
@@ -153,10 +153,10 @@ class MmapCacheFileManagerBindings {
 
   late final _flushToTargetFilePtr = _lookup<
       ffi.NativeFunction<
-          ffi.Void Function(ffi.Pointer<ffi.Void>,
+          ffi.Int Function(ffi.Pointer<ffi.Void>,
               ffi.Pointer<ffi.Char>)>>('flushToTargetFile');
   late final _flushToTargetFile = _flushToTargetFilePtr.asFunction<
-      void Function(ffi.Pointer<ffi.Void>, ffi.Pointer<ffi.Char>)>();
+      int Function(ffi.Pointer<ffi.Void>, ffi.Pointer<ffi.Char>)>();
 
   void flushMMapCacheFile() {
     return _flushMMapCacheFile();
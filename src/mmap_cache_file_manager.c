@@ -9,15 +9,21 @@
 - * The functions in this file include:
 - * - canUseMMapCacheFile(): checks if the cache file can be used 
 - * - setTargetFilePath(): set the  file path and flushes any existing  messages to the  file
+- * - setTagTargetFilePath(): set the target file path for a tagged stream
 - * - writeToMMAPCacheFile(): writes a  message to the cache file
-- * - flushToTargetFile(): flushes the cache to the  file on disk
+- * - writeBytesToMMAPCacheFile(): writes a byte buffer of known length to the cache file
+- * - writeBytesToMMAPCacheFileWithTag(): writes a byte buffer to a tagged stream
+- * - reserveMMAPCacheSpace() / commitMMAPCacheSpace(): write directly into the mapped cache space
+- * - reserveMMAPCacheSpaceWithTag(): reserves mapped cache space for a tagged stream
+- * - flushToTargetFile(): flushes the cache to the  file on disk, one write per target file
 - * - updateMMapHeaderContentLength(): updates the cache size in the cache file header
 - * - clearMMAPHeaderContentLength(): clears the cache size in the cache file header
-- * - resetMMAPHeader(): resets the cache file header to all zeros
+- * - resetMMAPHeader(): resets the cache file header and tag table to all zeros
 - * - getContentTotalLength(): gets the total length of the  file from the cache file header
 - * - getTargetFilePath(): gets the  file path from the cache file header
 - * - forceFlushToFile(): forces a flush of the cache to the  file on disk
 - * - flushMMapCacheFile(): flushes the cache to the cache file on disk
+- * - closeMMapCacheFile(): flushes the cache and unmaps the cache file
 - * 
 - * @author BlakeKing
 - * @date 2023/4/25
@@ -33,10 +39,21 @@
 #include <string.h>
 #include <time.h>
 #include <stdlib.h>
+#include <limits.h>
+#include <sys/uio.h>
 #include "mmap.h"
 #include "config.h"
 #include "util.h"
 
+// Reserved space must fit in the room the mapping keeps free past the cached content.
+#if MMAP_CACHE_MAX_RESERVE_LENGTH > SECTION_LENGTH
+#error "MMAP_CACHE_MAX_RESERVE_LENGTH must not exceed SECTION_LENGTH"
+#endif
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
 /**
  * @brief Static variables used for mmap cache file manager.
  * 
@@ -48,6 +65,24 @@ static unsigned char *_mmapCacheFileBuffer = NULL;
 static int _fileTotalLength = 0;
 static char *_targetFilePath = NULL;
 
+/**
+ * @brief Static variables describing the space handed out by reserveMMAPCacheSpace().
+ * 
+ * _reservedLength: Number of bytes reserved, or 0 if nothing is reserved.
+ * _reservedContentLength: Content length when the space was reserved; a write or flush since then invalidates it.
+ */
+static int _reservedLength = 0;
+static int _reservedContentLength = 0;
+
+/**
+ * @brief Static variables used for tagged records.
+ * 
+ * _lastRecordOffset: Offset of the last record header within the content, or -1 if there is none.
+ * _reservedTag: Tag of the last space handed out by reserveMMAPCacheSpaceWithTag().
+ */
+static int _lastRecordOffset = -1;
+static int _reservedTag = 0;
+
 // This section defines the header information for the cache file, which includes the byte length of the target file path, the byte length of the target file path itself, and the byte length of the content to be written to the file.
 // The byte length of the target file path is represented by TARGET_FILE_BYTE_LENGTH, which is currently set to 2.
 static int TARGET_FILE_BYTE_LENGTH = 2;
@@ -56,6 +91,265 @@ static int TARGET_FILE_PATH_BYTE_LENGTH = 1024;
 // The byte length of the content to be written to the file is represented by CONTENT_BYTE_LENGTH, which is currently set to 4.
 static int CONTENT_BYTE_LENGTH = 4;
 
+// The content length is followed by the tag table: a 4-byte magic, then one entry per tag from 1 to MMAP_CACHE_MAX_STREAM_TAG_COUNT - 1,
+// each laid out like the target file path above (2-byte length followed by the path). Tag 0 uses the target file path above.
+// A cache file written before tags existed has no magic, and its content is raw bytes for the target file path.
+static const unsigned char TAG_TABLE_MAGIC[] = {0xFE, 'M', 'T', 0x01};
+static int TAG_TABLE_MAGIC_BYTE_LENGTH = 4;
+// The content is a sequence of records, each a 1-byte tag and a 4-byte length followed by the data.
+// Consecutive writes to the same tag extend the last record instead of starting a new one.
+static int RECORD_TAG_BYTE_LENGTH = 1;
+static int RECORD_LENGTH_BYTE_LENGTH = 4;
+
+// Byte length of the header written before tags existed.
+static int legacyHeaderLength(void){
+    return TARGET_FILE_BYTE_LENGTH+TARGET_FILE_PATH_BYTE_LENGTH+CONTENT_BYTE_LENGTH;
+}
+
+// Byte length of the header including the tag table; the records start right after it.
+static int headerLength(void){
+    return legacyHeaderLength()+TAG_TABLE_MAGIC_BYTE_LENGTH+(MMAP_CACHE_MAX_STREAM_TAG_COUNT-1)*(TARGET_FILE_BYTE_LENGTH+TARGET_FILE_PATH_BYTE_LENGTH);
+}
+
+static int recordHeaderLength(void){
+    return RECORD_TAG_BYTE_LENGTH+RECORD_LENGTH_BYTE_LENGTH;
+}
+
+// Returns 1 if the cache file header carries a tag table, 0 if it uses the layout from before tags existed.
+static int hasTagTable(void * mmapFilePtr){
+    return memcmp((unsigned char *)mmapFilePtr+legacyHeaderLength(), TAG_TABLE_MAGIC, TAG_TABLE_MAGIC_BYTE_LENGTH) == 0;
+}
+
+// Returns a pointer to the cached content for either header layout.
+static unsigned char *contentPtr(void * mmapFilePtr){
+    return (unsigned char *)mmapFilePtr+(hasTagTable(mmapFilePtr) ? headerLength() : legacyHeaderLength());
+}
+
+// Returns a pointer to the tag table entry of the given tag, which must be in the range 1 to MMAP_CACHE_MAX_STREAM_TAG_COUNT - 1.
+static unsigned char *tagEntryPtr(void * mmapFilePtr, int tag){
+    return (unsigned char *)mmapFilePtr+legacyHeaderLength()+TAG_TABLE_MAGIC_BYTE_LENGTH+(tag-1)*(TARGET_FILE_BYTE_LENGTH+TARGET_FILE_PATH_BYTE_LENGTH);
+}
+
+// Reads a 4-byte little-endian integer.
+static int readLittleEndianInt(const unsigned char * dataPtr){
+    char lenArray[] = {dataPtr[0], dataPtr[1], dataPtr[2], dataPtr[3]};
+    adjustByteorder(lenArray);
+    int *value = (int *) lenArray;
+    return *value;
+}
+
+// Writes a 4-byte little-endian integer.
+static void writeLittleEndianInt(unsigned char * dataPtr, int value){
+    dataPtr[0] = value;
+    dataPtr[1] = value>>8;
+    dataPtr[2] = value>>16;
+    dataPtr[3] = value>>24;
+}
+
+// Returns the target file path registered for the given tag, or NULL if none is registered.
+// The path is stored NUL-terminated in the tag table, so it can be used in place.
+static const char *getTagTargetFilePath(void * mmapFilePtr, int tag){
+    unsigned char *entryPtr = tagEntryPtr(mmapFilePtr, tag);
+    int len = entryPtr[0] | (entryPtr[1]<<8);
+    // A damaged entry must not send the records to a path that runs into the next entry.
+    if (len <= 0 || len >= TARGET_FILE_PATH_BYTE_LENGTH || entryPtr[TARGET_FILE_BYTE_LENGTH+len] != '\0') {
+        return NULL;
+    }
+    return (const char *)(entryPtr+TARGET_FILE_BYTE_LENGTH);
+}
+
+// Returns 1 if data for the given tag can be appended to the last record instead of starting a new one.
+static int canExtendLastRecord(int tag){
+    return _lastRecordOffset >= 0 && _mmapCacheFileBuffer[headerLength()+_lastRecordOffset] == tag;
+}
+
+// Returns a pointer to where the next data for the given tag is written, leaving room for a record header if one is needed.
+static unsigned char *recordDataPtr(int tag){
+    unsigned char *endPtr = _mmapCacheFileBuffer+headerLength()+_fileTotalLength;
+    return canExtendLastRecord(tag) ? endPtr : endPtr+recordHeaderLength();
+}
+
+// Appends len bytes, already written at recordDataPtr(tag), to the content.
+static void commitRecord(int tag, int len){
+    if (len <= 0) {
+        return;
+    }
+    unsigned char *content = _mmapCacheFileBuffer+headerLength();
+    if (canExtendLastRecord(tag)) {
+        unsigned char *lengthPtr = content+_lastRecordOffset+RECORD_TAG_BYTE_LENGTH;
+        writeLittleEndianInt(lengthPtr, readLittleEndianInt(lengthPtr)+len);
+    } else {
+        unsigned char *recordPtr = content+_fileTotalLength;
+        *recordPtr = tag;
+        writeLittleEndianInt(recordPtr+RECORD_TAG_BYTE_LENGTH, len);
+        _lastRecordOffset = _fileTotalLength;
+        _fileTotalLength += recordHeaderLength();
+    }
+    // Update the total length of the content in the memory mapping cache file.
+    _fileTotalLength += len;
+    // Update the length of the content in the memory mapping cache file in the header.
+    updateMMapHeaderContentLength(_mmapCacheFileBuffer);
+    // If the total length of the content in the memory mapping cache file exceeds the cache length,
+    // flush the content to the target file.
+    // If the target file cannot take it, the content is dropped, since the mapping has no room to keep it.
+    if (_fileTotalLength > (CACHE_LENGTH) && !flushToTargetFile(_mmapCacheFileBuffer,_targetFilePath)){
+        clearMMAPHeaderContentLength(_mmapCacheFileBuffer);
+    }
+}
+
+// Copies len bytes of data into the content as a record of the given tag.
+static void appendRecord(int tag, const void * data, int len){
+    memcpy(recordDataPtr(tag), data, len);
+    commitRecord(tag, len);
+}
+
+// Returns the data length of the record at offset, clamped to the content length.
+// Extending the last record updates its length before the content length, so after a crash the
+// record may claim more data than the content holds; the data that did make it in is kept.
+static int recordDataLength(const unsigned char * content, int offset){
+    int len = readLittleEndianInt(content+offset+RECORD_TAG_BYTE_LENGTH);
+    int availableLength = _fileTotalLength-offset-recordHeaderLength();
+    return (len < 0 || len > availableLength) ? availableLength : len;
+}
+
+// Opens the target file for appending; returns -1 if it cannot be opened.
+static int openTargetFile(const char * filePath){
+    int fd = open(filePath, O_WRONLY | O_CREAT | O_APPEND, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+    debugPrint("mmap:flushToFile:%s\n",filePath);
+    if (fd == -1) {
+        debugPrint("open(%s) fail: %s\n", filePath, strerror(errno));
+    }
+    return fd;
+}
+
+// Appends the given records to the open target file with as few writev() calls as possible, normally one.
+// Short writes resume where they stopped, and calls interrupted by a signal are retried.
+// The records array is advanced in place.
+static void writeRecordsToTargetFile(int fd, struct iovec * records, int count){
+    while (count > 0) {
+        int batch = count < IOV_MAX ? count : IOV_MAX;
+        ssize_t written = writev(fd, records, batch);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            debugPrint("writev() fail: %s\n", strerror(errno));
+            break;
+        }
+        int remainingCount = count;
+        // Skip the records written in full, then move into the one written in part.
+        while (count > 0 && (size_t)written >= records->iov_len) {
+            written -= records->iov_len;
+            records++;
+            count--;
+        }
+        if (count > 0) {
+            records->iov_base = (char *)records->iov_base+written;
+            records->iov_len -= written;
+        }
+        // Nothing was written although data remains; give up instead of spinning.
+        if (written == 0 && count == remainingCount) {
+            break;
+        }
+    }
+}
+
+// Returns the tag whose target file receives the record at offset.
+static int routedRecordTag(const unsigned char * content, int offset, const int * fds){
+    int tag = content[offset];
+    return (tag >= MMAP_CACHE_MAX_STREAM_TAG_COUNT || fds[tag] == -1) ? 0 : tag;
+}
+
+// Groups the records by tag and writes each group to its target file.
+// Records whose tag has no registered target, or whose target cannot be opened, go to the default target file.
+// Returns 1 if the records were written, or 0 if nothing was written because the default target file is needed
+// but cannot be opened. If the grouping array cannot be allocated, the records are written one at a time.
+static int flushRecordsToTargetFiles(void * mmapFilePtr, const char * defaultFilePath){
+    unsigned char *content = (unsigned char *)mmapFilePtr+headerLength();
+    int fds[MMAP_CACHE_MAX_STREAM_TAG_COUNT];
+    int recordCounts[MMAP_CACHE_MAX_STREAM_TAG_COUNT] = {0};
+    int nextRecords[MMAP_CACHE_MAX_STREAM_TAG_COUNT];
+    int recordCount = 0;
+    int offset = 0;
+    int tag = 0;
+
+    // Count the records of each tag; a record header cut off at the end of the content is ignored.
+    int validLength = 0;
+    while (offset+recordHeaderLength() <= _fileTotalLength) {
+        tag = content[offset];
+        recordCounts[tag < MMAP_CACHE_MAX_STREAM_TAG_COUNT ? tag : 0]++;
+        recordCount++;
+        offset += recordHeaderLength()+recordDataLength(content, offset);
+        validLength = offset;
+    }
+    if (recordCount == 0) {
+        return 1;
+    }
+
+    // Open the target file of each tag that has records, moving the records of the others to tag 0.
+    fds[0] = -1;
+    for (tag = 1; tag < MMAP_CACHE_MAX_STREAM_TAG_COUNT; tag++) {
+        const char *filePath = recordCounts[tag] > 0 ? getTagTargetFilePath(mmapFilePtr, tag) : NULL;
+        fds[tag] = filePath != NULL ? openTargetFile(filePath) : -1;
+        if (fds[tag] == -1) {
+            recordCounts[0] += recordCounts[tag];
+            recordCounts[tag] = 0;
+        }
+    }
+    if (recordCounts[0] > 0) {
+        fds[0] = defaultFilePath != NULL ? openTargetFile(defaultFilePath) : -1;
+        if (fds[0] == -1) {
+            for (tag = 1; tag < MMAP_CACHE_MAX_STREAM_TAG_COUNT; tag++) {
+                if (fds[tag] != -1) {
+                    close(fds[tag]);
+                }
+            }
+            return 0;
+        }
+    }
+
+    struct iovec *records = malloc(sizeof(struct iovec)*recordCount);
+    if (records == NULL) {
+        // Without the grouping array, write each record to its target file in content order.
+        for (offset = 0; offset < validLength; ) {
+            int len = recordDataLength(content, offset);
+            struct iovec record = {content+offset+recordHeaderLength(), len};
+            writeRecordsToTargetFile(fds[routedRecordTag(content, offset, fds)], &record, 1);
+            offset += recordHeaderLength()+len;
+        }
+    } else {
+        // Lay the records out grouped by target, keeping their order within each target.
+        nextRecords[0] = 0;
+        for (tag = 1; tag < MMAP_CACHE_MAX_STREAM_TAG_COUNT; tag++) {
+            nextRecords[tag] = nextRecords[tag-1]+recordCounts[tag-1];
+        }
+        for (offset = 0; offset < validLength; ) {
+            int len = recordDataLength(content, offset);
+            tag = routedRecordTag(content, offset, fds);
+            records[nextRecords[tag]].iov_base = content+offset+recordHeaderLength();
+            records[nextRecords[tag]].iov_len = len;
+            nextRecords[tag]++;
+            offset += recordHeaderLength()+len;
+        }
+
+        int first = 0;
+        for (tag = 0; tag < MMAP_CACHE_MAX_STREAM_TAG_COUNT; tag++) {
+            if (recordCounts[tag] > 0) {
+                writeRecordsToTargetFile(fds[tag], records+first, recordCounts[tag]);
+            }
+            first += recordCounts[tag];
+        }
+        free(records);
+    }
+
+    for (tag = 0; tag < MMAP_CACHE_MAX_STREAM_TAG_COUNT; tag++) {
+        if (fds[tag] != -1) {
+            close(fds[tag]);
+        }
+    }
+    return 1;
+}
+
 
 /**
  * Checks if the specified file can be memory-mapped for caching.
@@ -64,6 +358,10 @@ static int CONTENT_BYTE_LENGTH = 4;
  * @return Returns 1 if the file can be memory-mapped, 0 otherwise.
  */
 int canUseMMapCacheFile(const char * mmapCacheFilePath){
+    // The mapping is shared by the whole process; keep the one already open instead of leaking it.
+    if (_mmapCacheFileBuffer != NULL) {
+        return OPEN_MMAP_SUCCESS;
+    }
     int canMmap = openMMapCacheFile(mmapCacheFilePath, &_mmapCacheFileBuffer);
     return canMmap;
 }
@@ -75,6 +373,12 @@ int canUseMMapCacheFile(const char * mmapCacheFilePath){
  */
 void setTargetFilePath(const char * filePath){
     void * mmapFilePtr =_mmapCacheFileBuffer;
+    if (mmapFilePtr == NULL || filePath == NULL) {
+        return;
+    }
+
+    // The first call after the cache file is opened recovers the content of a previous run.
+    int isRecovering = _targetFilePath == NULL;
 
     // Free the previously set target file path if it exists.
     if (_targetFilePath != NULL) {
@@ -83,8 +387,8 @@ void setTargetFilePath(const char * filePath){
     }
 
     // Allocate memory for the new target file path and copy the input file path to it.
-    _targetFilePath = (char*)malloc(strlen(filePath));
-    memset(_targetFilePath, 0, strlen(filePath));
+    _targetFilePath = (char*)malloc(strlen(filePath)+1);
+    memset(_targetFilePath, 0, strlen(filePath)+1);
     strcpy(_targetFilePath, filePath);
     
     // Get the total length of the content in the memory mapping cache file.
@@ -92,15 +396,24 @@ void setTargetFilePath(const char * filePath){
     debugPrint("mmap:_fileTotalLength:%d\n", _fileTotalLength);
 
     // If the content is not empty, flush it to the target file.
+    // If that file cannot be opened, the content goes to the new target file instead.
     if(_fileTotalLength > 0){
         char* filePath = getTargetFilePath(mmapFilePtr);
         debugPrint("mmap:filePath:%s\n", filePath);
-        flushToTargetFile(mmapFilePtr,filePath);
-        resetMMAPHeader(mmapFilePtr);
+        if (!flushToTargetFile(mmapFilePtr,filePath)) {
+            flushToTargetFile(mmapFilePtr,_targetFilePath);
+        }
         free(filePath);
         filePath = NULL;
     }
 
+    // When recovering or upgrading a header written before tags existed, start from a fresh header,
+    // which also drops the tag targets registered by a previous run. Later calls, such as rotating
+    // the target file, keep the tag targets registered in this run.
+    if (isRecovering || !hasTagTable(mmapFilePtr)) {
+        resetMMAPHeader(mmapFilePtr);
+    }
+
     debugPrint("mmap:start write filepath \n");
 
     // Write the length of the file path to the memory mapping cache file.
@@ -115,78 +428,173 @@ void setTargetFilePath(const char * filePath){
     memcpy(dataPtr, filePath, filePathStringLength+1);
 }
 
+/**
+ * @brief Sets the target file path for the records written with the given tag.
+ * 
+ * @param tag The stream tag, from 1 to MMAP_CACHE_MAX_STREAM_TAG_COUNT - 1.
+ * @param filePath The file path to set as the target.
+ * @return Returns 1 if the target was set, 0 otherwise.
+ */
+int setTagTargetFilePath(int tag, const char * filePath){
+    if (_mmapCacheFileBuffer == NULL || !hasTagTable(_mmapCacheFileBuffer) ||
+        tag <= 0 || tag >= MMAP_CACHE_MAX_STREAM_TAG_COUNT || filePath == NULL) {
+        return 0;
+    }
+    int filePathStringLength = (int)strlen(filePath);
+    if (filePathStringLength == 0 || filePathStringLength >= TARGET_FILE_PATH_BYTE_LENGTH) {
+        return 0;
+    }
+
+    // Route the records already cached to the current targets before changing them.
+    if (_fileTotalLength > 0) {
+        forceFlushToFile();
+    }
+
+    unsigned char *dataPtr = tagEntryPtr(_mmapCacheFileBuffer, tag);
+    *dataPtr = filePathStringLength;
+    dataPtr++;
+    *dataPtr = filePathStringLength>>8;
+    dataPtr++;
+    memcpy(dataPtr, filePath, filePathStringLength+1);
+    return 1;
+}
+
 
 /**
  * Writes a message to the memory mapping cache file.
  * 
  * @param message The message to be written.
  */
-void writeToMMAPCacheFile(char * message){
+void writeToMMAPCacheFile(const char * message){
+    if (message == NULL) {
+        return;
+    }
     debugPrint("mmap:writeToMMAPCacheFile\n");
-    int appendSize = (int)strlen(message);
+    writeBytesToMMAPCacheFile(message, (int)strlen(message));
+}
+
+/**
+ * Writes a byte buffer of known length to the memory mapping cache file.
+ * 
+ * @param data The bytes to be written, which may contain embedded NUL characters.
+ * @param len The number of bytes to be written.
+ */
+void writeBytesToMMAPCacheFile(const void * data, int len){
+    writeBytesToMMAPCacheFileWithTag(0, data, len);
+}
 
-    // Divide the message into sections of SECTION_LENGTH and write each section to the memory mapping cache file.
+/**
+ * Writes a byte buffer of known length to the memory mapping cache file as records of the given tag.
+ * 
+ * @param tag The stream tag, from 0 to MMAP_CACHE_MAX_STREAM_TAG_COUNT - 1.
+ * @param data The bytes to be written, which may contain embedded NUL characters.
+ * @param len The number of bytes to be written.
+ */
+void writeBytesToMMAPCacheFileWithTag(int tag, const void * data, int len){
+    if (_mmapCacheFileBuffer == NULL || tag < 0 || tag >= MMAP_CACHE_MAX_STREAM_TAG_COUNT ||
+        data == NULL || len <= 0) {
+        return;
+    }
+    int appendSize = len;
+
+    // Divide the data into sections of SECTION_LENGTH and write each section to the memory mapping cache file.
     int size = SECTION_LENGTH;
     int times = appendSize / size;
     int remainLen = appendSize % size;
-    char *temp = message;
+    const char *temp = data;
     int i = 0;
     for (i = 0; i < times; i++) {
-        writeToMMAPCacheFileWithLength(temp, size);
+        appendRecord(tag, temp, size);
         temp += size;
     }
     // Write the remaining part of the message to the memory mapping cache file.
     if (remainLen) {
-        writeToMMAPCacheFileWithLength(temp, remainLen);
+        appendRecord(tag, temp, remainLen);
     }
 }
 
 // This function writes a message to the memory mapping cache file with a specified length.
 // It takes in a message and its length as input parameters.
-void writeToMMAPCacheFileWithLength(char * message, int len){
-    void * dataPtr;//mmap point
-     //4个字节长度
-    // Set the data pointer to the location in memory where the message should be written.
-    dataPtr =_mmapCacheFileBuffer+TARGET_FILE_BYTE_LENGTH+TARGET_FILE_PATH_BYTE_LENGTH+CONTENT_BYTE_LENGTH+_fileTotalLength;
-    // Copy the message to the memory location pointed to by the data pointer.
-    memcpy(dataPtr, message, len);
-    // Update the total length of the content in the memory mapping cache file.
-    _fileTotalLength += len;
-    // Update the length of the content in the memory mapping cache file in the header.
-    updateMMapHeaderContentLength(_mmapCacheFileBuffer);
-    // If the total length of the content in the memory mapping cache file exceeds the cache length,
-    // flush the content to the target file.
-    if (_fileTotalLength > (CACHE_LENGTH)){
-        flushToTargetFile(_mmapCacheFileBuffer,_targetFilePath);
+void writeToMMAPCacheFileWithLength(const char * message, int len){
+    writeBytesToMMAPCacheFileWithTag(0, message, len);
+}
+
+// This function returns a pointer to the end of the cached content so the caller can write into the mapping directly.
+char* reserveMMAPCacheSpace(int len){
+    return reserveMMAPCacheSpaceWithTag(0, len);
+}
+
+// This function returns a pointer to the end of the cached content for a record of the given tag.
+// Content never rests above CACHE_LENGTH, so the mapping always has at least SECTION_LENGTH bytes
+// and a record header free past it.
+char* reserveMMAPCacheSpaceWithTag(int tag, int len){
+    if (_mmapCacheFileBuffer == NULL || tag < 0 || tag >= MMAP_CACHE_MAX_STREAM_TAG_COUNT ||
+        len <= 0 || len > MMAP_CACHE_MAX_RESERVE_LENGTH) {
+        return NULL;
     }
+    _reservedTag = tag;
+    _reservedLength = len;
+    _reservedContentLength = _fileTotalLength;
+    return (char *)recordDataPtr(tag);
+}
+
+// This function appends len bytes, written into the space returned by the last reservation, to the content.
+// len is limited to the reserved length, and the reservation ends with the call.
+void commitMMAPCacheSpace(int len){
+    int reservedLength = _reservedLength;
+    _reservedLength = 0;
+    if (_mmapCacheFileBuffer == NULL || reservedLength == 0 ||
+        _reservedContentLength != _fileTotalLength || len <= 0) {
+        return;
+    }
+    commitRecord(_reservedTag, len < reservedLength ? len : reservedLength);
 }
 
 // This function flushes the content in the memory mapping cache file to the target file.
 // It takes in a pointer to the memory mapping cache file and the file path of the target file as input parameters.
-void flushToTargetFile(void * mmapFilePtr,const char * filePath) {
+// Records of tags with a registered target file are written to that file instead.
+// The content is cleared only once it has been written; if the target file cannot be opened it is kept and 0 is returned.
+int flushToTargetFile(void * mmapFilePtr,const char * filePath) {
+    if (mmapFilePtr == NULL) {
+        return 0;
+    }
+    if (hasTagTable(mmapFilePtr)) {
+        if (!flushRecordsToTargetFiles(mmapFilePtr, filePath)) {
+            return 0;
+        }
+        // Clear the content length in the memory mapping cache file header.
+        clearMMAPHeaderContentLength(mmapFilePtr);
+        return 1;
+    }
+    // The cache file was written before tags existed, so the content is raw bytes for filePath.
     // Open the target file in append mode.
-    FILE* fp = fopen(filePath, "at+");
+    FILE* fp = filePath != NULL ? fopen(filePath, "at+") : NULL;
     debugPrint("mmap:flushToFile:%s\n",filePath);
-    // If the file is opened successfully, write the content in the memory mapping cache file to the target file.
-    if(fp != NULL) {
-        debugPrint("mmap:fwrite start\n");
-        // Write the content in the memory mapping cache file to the target file.
-        fwrite(mmapFilePtr+TARGET_FILE_BYTE_LENGTH+TARGET_FILE_PATH_BYTE_LENGTH+CONTENT_BYTE_LENGTH, sizeof(char), _fileTotalLength, fp);
-        // Flush the output buffer of the target file.
-        fflush(fp);
-        // Close the target file.
-        fclose(fp);
-        debugPrint("mmap:fwrite end\n");
+    // If the file cannot be opened, keep the content for a later flush.
+    if(fp == NULL) {
+        return 0;
     }
+    debugPrint("mmap:fwrite start\n");
+    // Write the content in the memory mapping cache file to the target file.
+    fwrite(contentPtr(mmapFilePtr), sizeof(char), _fileTotalLength, fp);
+    // Flush the output buffer of the target file.
+    fflush(fp);
+    // Close the target file.
+    fclose(fp);
+    debugPrint("mmap:fwrite end\n");
     // Clear the content length in the memory mapping cache file header.
     debugPrint("mmap:clear  length\n");
     clearMMAPHeaderContentLength(mmapFilePtr);
+    return 1;
 }
 
 // This function updates the content length in the memory mapping cache file header.
 // It takes in a pointer to the memory mapping cache file as an input parameter.
 // The content length is written in little-endian byte order.
 void updateMMapHeaderContentLength(void * mmapFilePtr) {
+    if (mmapFilePtr == NULL) {
+        return;
+    }
     // Set the data pointer to the location in memory where the content length should be written.
     unsigned char * dataPtr = mmapFilePtr;
     dataPtr += (TARGET_FILE_BYTE_LENGTH+TARGET_FILE_PATH_BYTE_LENGTH);
@@ -203,12 +611,16 @@ void updateMMapHeaderContentLength(void * mmapFilePtr) {
 // This function clears the content length in the memory mapping cache file header.
 // It takes in a pointer to the memory mapping cache file as an input parameter.
 void clearMMAPHeaderContentLength(void * mmapFilePtr){
+    if (mmapFilePtr == NULL) {
+        return;
+    }
     // Read the total length of the content in the memory mapping cache file.
     int totalLength = getContentTotalLength(mmapFilePtr);
-    // Set the content length in the memory mapping cache file header to 0.
-    memset(mmapFilePtr+TARGET_FILE_BYTE_LENGTH+TARGET_FILE_PATH_BYTE_LENGTH, 0, totalLength+CONTENT_BYTE_LENGTH);
+    // Set the content in the memory mapping cache file to 0, leaving the tag table in place.
+    memset(contentPtr(mmapFilePtr), 0, totalLength);
     // Reset the total length of the content in the memory mapping cache file to 0.
     _fileTotalLength = 0;
+    _lastRecordOffset = -1;
     // Update the content length in the memory mapping cache file header to 0.
     updateMMapHeaderContentLength(mmapFilePtr);
 }
@@ -219,20 +631,29 @@ void clearMMAPHeaderContentLength(void * mmapFilePtr){
  * @param mmapFilePtr Pointer to the memory mapping cache file.
  */
 void resetMMAPHeader(void * mmapFilePtr){
+    if (mmapFilePtr == NULL) {
+        return;
+    }
     // Read the total length of the content in the memory mapping cache file.
     int totalLength = getContentTotalLength(mmapFilePtr);
-    // Set all values in the memory mapping cache file header to 0.
-    memset(mmapFilePtr, 0, totalLength+TARGET_FILE_BYTE_LENGTH+TARGET_FILE_PATH_BYTE_LENGTH+CONTENT_BYTE_LENGTH);
+    // Set all values in the memory mapping cache file header, including the tag table, to 0.
+    memset(mmapFilePtr, 0, totalLength+headerLength());
     // Reset the total length of the content in the memory mapping cache file to 0.
     _fileTotalLength = 0;
+    _lastRecordOffset = -1;
     // Update the content length in the memory mapping cache file header to 0.
     updateMMapHeaderContentLength(mmapFilePtr);
+    // Mark the header as carrying a tag table so the content is read back as records.
+    memcpy((unsigned char *)mmapFilePtr+legacyHeaderLength(), TAG_TABLE_MAGIC, TAG_TABLE_MAGIC_BYTE_LENGTH);
 }
 
 // This function gets the total length of the content saved in the cache file.
 // It takes in a pointer to the memory mapping cache file as an input parameter.
 // The content length is read in little-endian byte order.
 int getContentTotalLength(void * mmapFilePtr){
+    if (mmapFilePtr == NULL) {
+        return 0;
+    }
     // Set the data pointer to the location in memory where the content length should be read.
     unsigned char *dataPtr = mmapFilePtr;
     dataPtr +=(TARGET_FILE_BYTE_LENGTH+TARGET_FILE_PATH_BYTE_LENGTH);
@@ -257,6 +678,9 @@ int getContentTotalLength(void * mmapFilePtr){
 // It takes in a pointer to the memory mapping cache file as an input parameter.
 // The target file path is read in little-endian byte order.
 char* getTargetFilePath(void * mmapFilePtr){
+    if (mmapFilePtr == NULL) {
+        return NULL;
+    }
     // Set the data pointer to the location in memory where the target file path should be read.
     unsigned char *tempMmapFilePtr = mmapFilePtr;
     char lenArray[] = {'\0', '\0','\0','\0'};
@@ -273,7 +697,7 @@ char* getTargetFilePath(void * mmapFilePtr){
     int len = *totalLen;
     
     // Allocate memory for the target file path and copy it from the memory mapping cache file.
-    char* dst = (char*)malloc(len);
+    char* dst = (char*)malloc(len+1);
     memcpy(dst, tempMmapFilePtr, len+1);
     
     // Print the target file path for debugging purposes.
@@ -288,6 +712,9 @@ char* getTargetFilePath(void * mmapFilePtr){
  * 
  */
 void forceFlushToFile(){
+    if (_mmapCacheFileBuffer == NULL) {
+        return;
+    }
     flushToTargetFile(_mmapCacheFileBuffer,_targetFilePath);
 }
 
@@ -295,5 +722,38 @@ void forceFlushToFile(){
  * Flushes the memory mapping cache file.
  */
 void flushMMapCacheFile(){
-    msync(_mmapCacheFileBuffer, _fileTotalLength, MS_ASYNC);
+    if (_mmapCacheFileBuffer == NULL) {
+        return;
+    }
+    msync(_mmapCacheFileBuffer, headerLength()+_fileTotalLength, MS_ASYNC);
+}
+
+/**
+ * Returns 1 if the memory mapping cache file is currently mapped, 0 otherwise.
+ */
+int isMMapCacheFileOpen(){
+    return _mmapCacheFileBuffer != NULL;
+}
+
+/**
+ * Flushes the cached content to the target file and unmaps the memory mapping cache file.
+ */
+void closeMMapCacheFile(){
+    if (_mmapCacheFileBuffer == NULL) {
+        return;
+    }
+    if (_targetFilePath != NULL && _fileTotalLength > 0) {
+        flushToTargetFile(_mmapCacheFileBuffer,_targetFilePath);
+    }
+    msync(_mmapCacheFileBuffer, MMAP_LENGTH, MS_SYNC);
+    munmap(_mmapCacheFileBuffer, MMAP_LENGTH);
+    _mmapCacheFileBuffer = NULL;
+    _fileTotalLength = 0;
+    _reservedLength = 0;
+    _lastRecordOffset = -1;
+
+    if (_targetFilePath != NULL) {
+        free(_targetFilePath);
+        _targetFilePath = NULL;
+    }
 }
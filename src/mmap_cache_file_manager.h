@@ -19,6 +19,20 @@
 #ifndef mmap_cache_file_manager_h
 #define mmap_cache_file_manager_h
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * The largest number of bytes reserveMMAPCacheSpace() and reserveMMAPCacheSpaceWithTag() can reserve.
+ */
+#define MMAP_CACHE_MAX_RESERVE_LENGTH (80 * 1024)
+
+/**
+ * The number of stream tags; valid tags run from 0 to MMAP_CACHE_MAX_STREAM_TAG_COUNT - 1.
+ * Tag 0 is the default target file set by setTargetFilePath().
+ */
+#define MMAP_CACHE_MAX_STREAM_TAG_COUNT 16
 
 /**
  * Checks if the specified file path can be used for memory mapping cache file.
@@ -35,13 +49,25 @@ int canUseMMapCacheFile(const char * mmapCacheFilePath);
  */
 void setTargetFilePath(const char * targetFilePath);
 
+/**
+ * Set the target file path for the records written with the given stream tag.
+ * Tag 0 always uses the path set by setTargetFilePath(), and records of a tag without a target go there too.
+ * Registrations are kept in the cache file header. The first setTargetFilePath() after the cache file is opened
+ * clears them, so register after it; later setTargetFilePath() calls keep them.
+ *
+ * @param tag The stream tag, from 1 to MMAP_CACHE_MAX_STREAM_TAG_COUNT - 1.
+ * @param targetFilePath The file path to set as the target.
+ * @return 1 if the target was set, 0 otherwise.
+ */
+int setTagTargetFilePath(int tag, const char * targetFilePath);
+
 
 /**
  * Writes the specified message to the memory mapping cache file.
  *
  * @param message The message to write to the cache file.
  */
-void writeToMMAPCacheFile(char * message);
+void writeToMMAPCacheFile(const char * message);
 
 /**
  * Writes the specified message to the memory mapping cache file.
@@ -49,7 +75,53 @@ void writeToMMAPCacheFile(char * message);
  * @param message The message to write to the cache file.
  * @param len The length of the message to write to the cache file.
  */
-void writeToMMAPCacheFileWithLength(char * message, int len);
+void writeToMMAPCacheFileWithLength(const char * message, int len);
+
+/**
+ * Writes the specified bytes to the memory mapping cache file without relying on a terminating NUL,
+ * so the data may contain embedded NUL characters.
+ *
+ * @param data The bytes to write to the cache file.
+ * @param len The number of bytes to write.
+ */
+void writeBytesToMMAPCacheFile(const void * data, int len);
+
+/**
+ * Writes the specified bytes to the memory mapping cache file as records of the given stream tag.
+ * On flush, the records of each tag are written to that tag's target file.
+ *
+ * @param tag The stream tag, from 0 to MMAP_CACHE_MAX_STREAM_TAG_COUNT - 1.
+ * @param data The bytes to write to the cache file.
+ * @param len The number of bytes to write.
+ */
+void writeBytesToMMAPCacheFileWithTag(int tag, const void * data, int len);
+
+/**
+ * Reserves space at the end of the cached content so a caller can write into the mapping directly.
+ * The reserved bytes are not part of the content until commitMMAPCacheSpace() is called.
+ *
+ * @param len The number of bytes to reserve, at most MMAP_CACHE_MAX_RESERVE_LENGTH.
+ * @return A pointer to the reserved space, or NULL if the cache file is not open or len is out of range.
+ */
+char* reserveMMAPCacheSpace(int len);
+
+/**
+ * Reserves space like reserveMMAPCacheSpace() for a record of the given stream tag.
+ *
+ * @param tag The stream tag, from 0 to MMAP_CACHE_MAX_STREAM_TAG_COUNT - 1.
+ * @param len The number of bytes to reserve, at most MMAP_CACHE_MAX_RESERVE_LENGTH.
+ * @return A pointer to the reserved space, or NULL if the cache file is not open or tag or len is out of range.
+ */
+char* reserveMMAPCacheSpaceWithTag(int tag, int len);
+
+/**
+ * Commits bytes previously written into the space returned by the last reserveMMAPCacheSpace() or
+ * reserveMMAPCacheSpaceWithTag() and ends that reservation. The call is ignored if nothing is reserved,
+ * or if the content changed since the space was reserved; len is limited to the reserved length.
+ *
+ * @param len The number of bytes written.
+ */
+void commitMMAPCacheSpace(int len);
 
 
 /**
@@ -83,12 +155,15 @@ int getContentTotalLength(void * mmapFilePtr);
 
 
 /**
- * Flushes the memory mapping cache file to the target file.
+ * Flushes the memory mapping cache file to the target file, and the records of each tag with a target to that tag's target file.
+ * Records whose tag target cannot be opened go to the target file. If the target file is needed but cannot be opened,
+ * nothing is written and the content stays in the cache file.
  *
  * @param mmapFilePtr A pointer to the memory mapping cache file.
  * @param filePath The path to the target file.
+ * @return 1 if the content was written and cleared, 0 if it was kept.
  */
-void flushToTargetFile(void * mmapFilePtr,const char * filePath);
+int flushToTargetFile(void * mmapFilePtr,const char * filePath);
 
 /**
  * Gets the path to the target file.
@@ -110,5 +185,21 @@ void forceFlushToFile();
  */
 void flushMMapCacheFile();
 
+/**
+ * Checks whether the memory mapping cache file is currently mapped by this process.
+ *
+ * @return 1 if the cache file is mapped, 0 otherwise.
+ */
+int isMMapCacheFileOpen();
+
+/**
+ * Flushes any cached content to the target file, then unmaps the memory mapping cache file
+ * and releases the target file path.
+ */
+void closeMMapCacheFile();
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif /* mmap_cache_file_manager_h */
@@ -0,0 +1,277 @@
+/**
+ * @file mmap_cache_file_manager.hpp
+ * @brief Header-only C++17 front-end for the mmap cache file manager.
+ *
+ * MMapCacheFile owns the memory mapping cache file opened through the C API in
+ * mmap_cache_file_manager.h. It is move-only; the mapping is flushed to the target
+ * file and unmapped when the owning instance is destroyed.
+ *
+ * The write() overloads take an explicit length, so they never call strlen and accept
+ * data with embedded NUL characters. format() and printf() write formatted text straight
+ * into the mapped space without allocating. format() is available with std::format (C++20)
+ * and checks its format string at compile time; printf() is checked by the compiler's
+ * format attribute.
+ *
+ * The writeTo(), formatTo() and printfTo() variants route the data to a stream tag whose
+ * target file is registered with setTagTarget(); the plain variants write to tag 0.
+ */
+
+#ifndef mmap_cache_file_manager_hpp
+#define mmap_cache_file_manager_hpp
+
+#include <cstdarg>
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#if __has_include(<version>)
+#include <version>
+#endif
+#if defined(__cpp_lib_span)
+#include <span>
+#endif
+#if defined(__cpp_lib_format)
+#include <format>
+#endif
+
+#include "mmap_cache_file_manager.h"
+
+#if defined(__GNUC__) || defined(__clang__)
+#define MMAP_CACHE_PRINTF_FORMAT(fmtIndex, argIndex) __attribute__((format(printf, fmtIndex, argIndex)))
+#else
+#define MMAP_CACHE_PRINTF_FORMAT(fmtIndex, argIndex)
+#endif
+
+namespace mmap_cache {
+
+/**
+ * Move-only owner of the memory mapping cache file.
+ *
+ * The C layer keeps a single global mapping shared by the whole process. Construction fails
+ * (isOpen() returns false) if the mapping is already open, whether through another
+ * MMapCacheFile or through the C API, so at most one instance ever unmaps it.
+ */
+class MMapCacheFile {
+public:
+    /** The largest number of bytes a single format() or printf() call can write. */
+    static constexpr int kMaxFormatLength = MMAP_CACHE_MAX_RESERVE_LENGTH;
+
+    /**
+     * Opens the memory mapping cache file and sets the target file path.
+     * Any content left in the cache file is flushed to its previous target file.
+     * Fails if the mapping is already open in this process.
+     *
+     * @param mmapCacheFilePath The path to the cache file.
+     * @param targetFilePath The path to the target file.
+     */
+    MMapCacheFile(const std::string &mmapCacheFilePath, const std::string &targetFilePath)
+        : _isOpen(!isMMapCacheFileOpen() && canUseMMapCacheFile(mmapCacheFilePath.c_str()) == 1) {
+        if (_isOpen) {
+            setTargetFilePath(targetFilePath.c_str());
+        }
+    }
+
+    MMapCacheFile(const MMapCacheFile &) = delete;
+    MMapCacheFile &operator=(const MMapCacheFile &) = delete;
+
+    MMapCacheFile(MMapCacheFile &&other) noexcept
+        : _isOpen(std::exchange(other._isOpen, false)) {}
+
+    MMapCacheFile &operator=(MMapCacheFile &&other) noexcept {
+        if (this != &other) {
+            close();
+            _isOpen = std::exchange(other._isOpen, false);
+        }
+        return *this;
+    }
+
+    ~MMapCacheFile() { close(); }
+
+    /**
+     * @return true if this instance owns an open cache file.
+     */
+    bool isOpen() const noexcept { return _isOpen; }
+
+    explicit operator bool() const noexcept { return _isOpen; }
+
+    /**
+     * Sets the target file for the records written with the given stream tag.
+     *
+     * @param tag The stream tag, from 1 to MMAP_CACHE_MAX_STREAM_TAG_COUNT - 1.
+     * @param targetFilePath The path to the target file.
+     * @return true if the target was set.
+     */
+    bool setTagTarget(int tag, const std::string &targetFilePath) const noexcept {
+        return _isOpen && setTagTargetFilePath(tag, targetFilePath.c_str()) == 1;
+    }
+
+    /**
+     * Writes the specified text to the cache file.
+     *
+     * @param message The text to write; its length is taken from the view, not from a terminating NUL.
+     */
+    void write(std::string_view message) const noexcept {
+        writeTo(0, message.data(), message.size());
+    }
+
+#if defined(__cpp_lib_span)
+    /**
+     * Writes the specified bytes to the cache file.
+     *
+     * @param data The bytes to write.
+     */
+    void write(std::span<const std::byte> data) const noexcept {
+        writeTo(0, data.data(), data.size());
+    }
+#endif
+
+    /**
+     * Writes the specified bytes to the cache file.
+     *
+     * @param data The bytes to write.
+     * @param len The number of bytes to write.
+     */
+    void write(const void *data, std::size_t len) const noexcept {
+        writeTo(0, data, len);
+    }
+
+    /**
+     * Writes the specified text to the stream with the given tag.
+     */
+    void writeTo(int tag, std::string_view message) const noexcept {
+        writeTo(tag, message.data(), message.size());
+    }
+
+#if defined(__cpp_lib_span)
+    /**
+     * Writes the specified bytes to the stream with the given tag.
+     */
+    void writeTo(int tag, std::span<const std::byte> data) const noexcept {
+        writeTo(tag, data.data(), data.size());
+    }
+#endif
+
+    /**
+     * Writes the specified bytes to the stream with the given tag.
+     *
+     * @param tag The stream tag, from 0 to MMAP_CACHE_MAX_STREAM_TAG_COUNT - 1.
+     * @param data The bytes to write.
+     * @param len The number of bytes to write.
+     */
+    void writeTo(int tag, const void *data, std::size_t len) const noexcept {
+        if (!_isOpen) {
+            return;
+        }
+        // Hand the C API at most MMAP_CACHE_MAX_RESERVE_LENGTH bytes at a time so the length always fits in an int.
+        const char *temp = static_cast<const char *>(data);
+        while (len > 0) {
+            std::size_t sectionLength = len < kMaxFormatLength ? len : kMaxFormatLength;
+            writeBytesToMMAPCacheFileWithTag(tag, temp, static_cast<int>(sectionLength));
+            temp += sectionLength;
+            len -= sectionLength;
+        }
+    }
+
+#if defined(__cpp_lib_format)
+    /**
+     * Formats the arguments directly into the mapped space. The format string is checked
+     * at compile time and output longer than kMaxFormatLength is truncated.
+     *
+     * @return The number of bytes written.
+     */
+    template <typename... Args>
+    int format(std::format_string<Args...> fmt, Args &&...args) const {
+        return formatTo(0, fmt, std::forward<Args>(args)...);
+    }
+
+    /**
+     * Formats the arguments like format() into the stream with the given tag.
+     *
+     * @return The number of bytes written.
+     */
+    template <typename... Args>
+    int formatTo(int tag, std::format_string<Args...> fmt, Args &&...args) const {
+        char *dataPtr = _isOpen ? reserveMMAPCacheSpaceWithTag(tag, kMaxFormatLength) : nullptr;
+        if (dataPtr == nullptr) {
+            return 0;
+        }
+        auto result = std::format_to_n(dataPtr, kMaxFormatLength, fmt, std::forward<Args>(args)...);
+        int len = static_cast<int>(result.out - dataPtr);
+        commitMMAPCacheSpace(len);
+        return len;
+    }
+#endif
+
+    /**
+     * Formats the arguments with a printf-style format directly into the mapped space.
+     * Output longer than kMaxFormatLength - 1 bytes is truncated.
+     *
+     * @return The number of bytes written.
+     */
+    int printf(const char *fmt, ...) const noexcept MMAP_CACHE_PRINTF_FORMAT(2, 3) {
+        va_list args;
+        va_start(args, fmt);
+        int len = vprintfTo(0, fmt, args);
+        va_end(args);
+        return len;
+    }
+
+    /**
+     * Formats the arguments like printf() into the stream with the given tag.
+     *
+     * @return The number of bytes written.
+     */
+    int printfTo(int tag, const char *fmt, ...) const noexcept MMAP_CACHE_PRINTF_FORMAT(3, 4) {
+        va_list args;
+        va_start(args, fmt);
+        int len = vprintfTo(tag, fmt, args);
+        va_end(args);
+        return len;
+    }
+
+    /**
+     * Forces a flush of the cached content to the target file of each stream.
+     */
+    void flush() const noexcept {
+        if (_isOpen) {
+            forceFlushToFile();
+        }
+    }
+
+    /**
+     * Flushes the cached content to the target file and unmaps the cache file.
+     */
+    void close() noexcept {
+        if (_isOpen) {
+            closeMMapCacheFile();
+            _isOpen = false;
+        }
+    }
+
+private:
+    int vprintfTo(int tag, const char *fmt, va_list args) const noexcept {
+        char *dataPtr = _isOpen ? reserveMMAPCacheSpaceWithTag(tag, kMaxFormatLength) : nullptr;
+        if (dataPtr == nullptr) {
+            return 0;
+        }
+        int len = std::vsnprintf(dataPtr, kMaxFormatLength, fmt, args);
+        if (len < 0) {
+            return 0;
+        }
+        if (len >= kMaxFormatLength) {
+            len = kMaxFormatLength - 1;
+        }
+        commitMMAPCacheSpace(len);
+        return len;
+    }
+
+    bool _isOpen;
+};
+
+} // namespace mmap_cache
+
+#undef MMAP_CACHE_PRINTF_FORMAT
+
+#endif /* mmap_cache_file_manager_hpp */
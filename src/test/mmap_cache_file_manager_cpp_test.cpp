@@ -0,0 +1,137 @@
+//
+//  mmap_cache_file_manager_cpp_test.cpp
+//  mmap
+//
+//  Checks the C++ wrapper against the contents of the target file.
+//  Built once as C++17 and once as C++20.
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <unistd.h>
+#include "../mmap_cache_file_manager.hpp"
+
+using mmap_cache::MMapCacheFile;
+
+static char _directory[] = "/tmp/mmap_cache_cpp_test_XXXXXX";
+static int _failures = 0;
+
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+        std::printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+        _failures++; \
+    } \
+} while (0)
+
+static std::string pathFor(const char *name){
+    return std::string(_directory)+"/"+name;
+}
+
+static std::string readFile(const std::string &path){
+    std::ifstream file(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+static void testMove(void){
+    MMapCacheFile a(pathFor("move.mmap"), pathFor("move.txt"));
+    CHECK(a.isOpen());
+    a.write(std::string_view("a"));
+
+    MMapCacheFile b(std::move(a));
+    CHECK(!a.isOpen());
+    CHECK(b.isOpen());
+    b.write(std::string_view("b"));
+    // The moved-from instance must not unmap the mapping it gave away.
+    a.close();
+    b.write(std::string_view("c"));
+
+    MMapCacheFile c(pathFor("unused.mmap"), pathFor("unused.txt"));
+    CHECK(!c.isOpen());
+    c = std::move(b);
+    CHECK(!b.isOpen());
+    CHECK(c.isOpen());
+    c.write(std::string_view("d"));
+    c.close();
+    CHECK(!isMMapCacheFileOpen());
+    CHECK(readFile(pathFor("move.txt")) == "abcd");
+}
+
+static void testSecondOwner(void){
+    MMapCacheFile a(pathFor("owner.mmap"), pathFor("owner.txt"));
+    CHECK(a.isOpen());
+    {
+        MMapCacheFile b(pathFor("owner.mmap"), pathFor("owner_b.txt"));
+        CHECK(!b.isOpen());
+        b.write(std::string_view("ignored"));
+    }
+    CHECK(isMMapCacheFileOpen());
+    a.write(std::string_view("kept"));
+    a.flush();
+    CHECK(readFile(pathFor("owner.txt")) == "kept");
+    a.close();
+    CHECK(readFile(pathFor("owner_b.txt")).empty());
+}
+
+static void testLengths(void){
+    MMapCacheFile a(pathFor("length.mmap"), pathFor("length.txt"));
+    std::string embedded("x\0y", 3);
+    a.write(std::string_view(embedded));
+
+    // Larger than a single section, so the wrapper has to split it.
+    std::string large(3*MMapCacheFile::kMaxFormatLength+7, 'L');
+    a.write(large.data(), large.size());
+    a.write(large.data(), 0);
+    a.close();
+    CHECK(readFile(pathFor("length.txt")) == embedded+large);
+}
+
+static void testPrintfTruncation(void){
+    MMapCacheFile a(pathFor("printf.mmap"), pathFor("printf.txt"));
+    CHECK(a.printf("%s=%d;", "n", 42) == 5);
+
+    std::string large(MMapCacheFile::kMaxFormatLength+100, 'P');
+    CHECK(a.printf("%s", large.c_str()) == MMapCacheFile::kMaxFormatLength-1);
+    a.close();
+    CHECK(readFile(pathFor("printf.txt")) == "n=42;"+large.substr(0, MMapCacheFile::kMaxFormatLength-1));
+}
+
+static void testModernOverloads(void){
+    MMapCacheFile a(pathFor("modern.mmap"), pathFor("modern.txt"));
+    std::string expected;
+#if defined(__cpp_lib_span)
+    const std::byte bytes[] = {std::byte{'s'}, std::byte{0}, std::byte{'p'}};
+    a.write(std::span<const std::byte>(bytes));
+    expected.append("s\0p", 3);
+#endif
+#if defined(__cpp_lib_format)
+    CHECK(a.format("{}-{}", "f", 7) == 3);
+    expected += "f-7";
+    std::string large(MMapCacheFile::kMaxFormatLength+100, 'F');
+    CHECK(a.format("{}", large) == MMapCacheFile::kMaxFormatLength);
+    expected += large.substr(0, MMapCacheFile::kMaxFormatLength);
+#endif
+    a.close();
+    CHECK(readFile(pathFor("modern.txt")) == expected);
+}
+
+int main(void){
+    if (mkdtemp(_directory) == NULL) {
+        std::perror("mkdtemp");
+        return 1;
+    }
+    testMove();
+    testSecondOwner();
+    testLengths();
+    testPrintfTruncation();
+    testModernOverloads();
+
+    std::string command = std::string("rm -rf ")+_directory;
+    std::system(command.c_str());
+
+    std::printf("%s\n", _failures == 0 ? "all checks passed" : "checks failed");
+    return _failures == 0 ? 0 : 1;
+}
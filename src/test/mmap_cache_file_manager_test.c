@@ -0,0 +1,270 @@
+//
+//  mmap_cache_file_manager_test.c
+//  mmap
+//
+//  Checks cache file recovery and tag routing. Crashes are simulated by writing
+//  from a forked child that exits without closing the cache file.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "../mmap_cache_file_manager.h"
+#include "../config.h"
+
+// Layout of the cache file header, see mmap_cache_file_manager.c.
+#define LEGACY_HEADER_LENGTH (2 + 1024 + 4)
+#define HEADER_LENGTH (LEGACY_HEADER_LENGTH + 4 + (MMAP_CACHE_MAX_STREAM_TAG_COUNT - 1) * (2 + 1024))
+
+static char _directory[] = "/tmp/mmap_cache_test_XXXXXX";
+static int _failures = 0;
+
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+        printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+        _failures++; \
+    } \
+} while (0)
+
+static char *pathFor(const char *name){
+    static char paths[8][256];
+    static int next = 0;
+    char *path = paths[next++ % 8];
+    snprintf(path, sizeof(paths[0]), "%s/%s", _directory, name);
+    return path;
+}
+
+// Reads a whole file into a NUL-terminated buffer; returns an empty string if it does not exist.
+static char *readFile(const char *path, long *length){
+    long size = 0;
+    char *data = NULL;
+    FILE *file = fopen(path, "rb");
+    if (file != NULL) {
+        fseek(file, 0, SEEK_END);
+        size = ftell(file);
+        fseek(file, 0, SEEK_SET);
+    }
+    data = calloc(size+1, 1);
+    if (file != NULL) {
+        fread(data, 1, size, file);
+        fclose(file);
+    }
+    if (length != NULL) {
+        *length = size;
+    }
+    return data;
+}
+
+static int fileEquals(const char *path, const char *expected){
+    char *data = readFile(path, NULL);
+    int equals = strcmp(data, expected) == 0;
+    if (!equals) {
+        printf("%s: expected \"%s\", got \"%s\"\n", path, expected, data);
+    }
+    free(data);
+    return equals;
+}
+
+// Reads the content length from the header of the cache file, which is shared with the mapping.
+static int cachedContentLength(const char *cachePath){
+    unsigned char length[4] = {0};
+    int fd = open(cachePath, O_RDONLY);
+    pread(fd, length, 4, 2+1024);
+    close(fd);
+    return length[0] | (length[1]<<8) | (length[2]<<16) | (length[3]<<24);
+}
+
+// Runs the given writes in a child process that exits without flushing, leaving them in the cache file.
+static void writeAndCrash(void (*writes)(void)){
+    pid_t pid = fork();
+    if (pid == 0) {
+        writes();
+        _exit(0);
+    }
+    waitpid(pid, NULL, 0);
+}
+
+static void testLegacyRecovery(void){
+    const char *cachePath = pathFor("legacy.mmap");
+    const char *legacyTarget = pathFor("legacy.txt");
+    const char *content = "written before tags\n";
+
+    // Build a cache file in the layout used before tags existed.
+    unsigned char *buffer = calloc(MMAP_LENGTH, 1);
+    int pathLength = (int)strlen(legacyTarget);
+    int contentLength = (int)strlen(content);
+    buffer[0] = pathLength;
+    buffer[1] = pathLength>>8;
+    memcpy(buffer+2, legacyTarget, pathLength+1);
+    buffer[2+1024] = contentLength;
+    memcpy(buffer+LEGACY_HEADER_LENGTH, content, contentLength);
+    FILE *file = fopen(cachePath, "wb");
+    fwrite(buffer, 1, MMAP_LENGTH, file);
+    fclose(file);
+    free(buffer);
+
+    CHECK(canUseMMapCacheFile(cachePath) == 1);
+    setTargetFilePath(pathFor("legacy_new.txt"));
+    CHECK(fileEquals(legacyTarget, content));
+
+    // The upgraded header now takes tagged records.
+    CHECK(setTagTargetFilePath(1, pathFor("legacy_tag.txt")) == 1);
+    writeBytesToMMAPCacheFileWithTag(1, "tag\n", 4);
+    writeToMMAPCacheFile("default\n");
+    closeMMapCacheFile();
+    CHECK(fileEquals(pathFor("legacy_tag.txt"), "tag\n"));
+    CHECK(fileEquals(pathFor("legacy_new.txt"), "default\n"));
+}
+
+static void writeInterleavedStreams(void){
+    canUseMMapCacheFile(pathFor("routing.mmap"));
+    setTargetFilePath(pathFor("routing_default.txt"));
+    setTagTargetFilePath(1, pathFor("routing_1.txt"));
+    setTagTargetFilePath(2, pathFor("routing_2.txt"));
+    int i = 0;
+    for (i = 0; i < 3; i++) {
+        writeToMMAPCacheFile("d");
+        writeBytesToMMAPCacheFileWithTag(1, "a\0", 2);
+        writeBytesToMMAPCacheFileWithTag(2, "b", 1);
+        writeBytesToMMAPCacheFileWithTag(7, "u", 1);
+    }
+}
+
+static void testRoutingAfterCrash(void){
+    writeAndCrash(writeInterleavedStreams);
+
+    CHECK(canUseMMapCacheFile(pathFor("routing.mmap")) == 1);
+    setTargetFilePath(pathFor("routing_next.txt"));
+    closeMMapCacheFile();
+
+    long length = 0;
+    char *data = readFile(pathFor("routing_1.txt"), &length);
+    CHECK(length == 6 && memcmp(data, "a\0a\0a\0", 6) == 0);
+    free(data);
+    CHECK(fileEquals(pathFor("routing_2.txt"), "bbb"));
+    // Tag 7 has no target, so its records go to the default target.
+    CHECK(fileEquals(pathFor("routing_default.txt"), "dududu"));
+}
+
+static void writeManyLines(void){
+    canUseMMapCacheFile(pathFor("cutoff.mmap"));
+    setTargetFilePath(pathFor("cutoff.txt"));
+    char line[32];
+    int i = 0;
+    for (i = 0; i < 1000; i++) {
+        int len = snprintf(line, sizeof(line), "line %d\n", i);
+        writeBytesToMMAPCacheFile(line, len);
+    }
+}
+
+static void testCutOffLastRecord(void){
+    writeAndCrash(writeManyLines);
+
+    // Simulate a crash between extending the last record and updating the content length.
+    int fd = open(pathFor("cutoff.mmap"), O_RDWR);
+    unsigned char length[4];
+    pread(fd, length, 4, HEADER_LENGTH+1);
+    int recordLength = length[0] | (length[1]<<8) | (length[2]<<16) | (length[3]<<24);
+    CHECK(recordLength == 8890);
+    recordLength += 9;
+    length[0] = recordLength;
+    length[1] = recordLength>>8;
+    length[2] = recordLength>>16;
+    length[3] = recordLength>>24;
+    pwrite(fd, length, 4, HEADER_LENGTH+1);
+    close(fd);
+
+    CHECK(canUseMMapCacheFile(pathFor("cutoff.mmap")) == 1);
+    setTargetFilePath(pathFor("cutoff_next.txt"));
+    closeMMapCacheFile();
+
+    long size = 0;
+    char *data = readFile(pathFor("cutoff.txt"), &size);
+    CHECK(size == 8890);
+    CHECK(size >= 9 && memcmp(data+size-9, "line 999\n", 9) == 0);
+    free(data);
+}
+
+static void writeUnterminatedTag(void){
+    canUseMMapCacheFile(pathFor("unterminated.mmap"));
+    setTargetFilePath(pathFor("unterminated_default.txt"));
+    setTagTargetFilePath(1, pathFor("unterminated_1.txt"));
+    writeBytesToMMAPCacheFileWithTag(1, "1", 1);
+}
+
+static void testUnterminatedTagTarget(void){
+    writeAndCrash(writeUnterminatedTag);
+
+    // Overwrite the NUL after the tag 1 path, as a damaged header would leave it.
+    int fd = open(pathFor("unterminated.mmap"), O_RDWR);
+    pwrite(fd, "x", 1, LEGACY_HEADER_LENGTH + 4 + 2 + strlen(pathFor("unterminated_1.txt")));
+    close(fd);
+
+    CHECK(canUseMMapCacheFile(pathFor("unterminated.mmap")) == 1);
+    setTargetFilePath(pathFor("unterminated_next.txt"));
+    closeMMapCacheFile();
+
+    CHECK(access(pathFor("unterminated_1.txt"), F_OK) != 0);
+    CHECK(fileEquals(pathFor("unterminated_default.txt"), "1"));
+}
+
+static void testUnopenableTargets(void){
+    CHECK(canUseMMapCacheFile(pathFor("unopenable.mmap")) == 1);
+    setTargetFilePath(pathFor("missing/default.txt"));
+    CHECK(setTagTargetFilePath(1, pathFor("missing/tag.txt")) == 1);
+    writeToMMAPCacheFile("d");
+    writeBytesToMMAPCacheFileWithTag(1, "1", 1);
+
+    // Neither target can be opened, so the content stays in the cache file.
+    forceFlushToFile();
+    CHECK(cachedContentLength(pathFor("unopenable.mmap")) > 0);
+
+    // Rotating to a target that can be opened takes the content, including the tag 1 records.
+    setTargetFilePath(pathFor("unopenable_default.txt"));
+    CHECK(cachedContentLength(pathFor("unopenable.mmap")) == 0);
+    CHECK(fileEquals(pathFor("unopenable_default.txt"), "d1"));
+
+    // Records of a tag whose target cannot be opened go to the default target.
+    writeBytesToMMAPCacheFileWithTag(1, "2", 1);
+    closeMMapCacheFile();
+    CHECK(fileEquals(pathFor("unopenable_default.txt"), "d12"));
+}
+
+static void testRotationKeepsTags(void){
+    CHECK(canUseMMapCacheFile(pathFor("rotate.mmap")) == 1);
+    setTargetFilePath(pathFor("rotate_a.txt"));
+    CHECK(setTagTargetFilePath(1, pathFor("rotate_tag.txt")) == 1);
+    writeToMMAPCacheFile("a");
+    writeBytesToMMAPCacheFileWithTag(1, "1", 1);
+    setTargetFilePath(pathFor("rotate_b.txt"));
+    writeToMMAPCacheFile("b");
+    writeBytesToMMAPCacheFileWithTag(1, "2", 1);
+    closeMMapCacheFile();
+
+    CHECK(fileEquals(pathFor("rotate_a.txt"), "a"));
+    CHECK(fileEquals(pathFor("rotate_b.txt"), "b"));
+    CHECK(fileEquals(pathFor("rotate_tag.txt"), "12"));
+}
+
+int main(void){
+    if (mkdtemp(_directory) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    testLegacyRecovery();
+    testRoutingAfterCrash();
+    testCutOffLastRecord();
+    testUnterminatedTagTarget();
+    testUnopenableTargets();
+    testRotationKeepsTags();
+
+    char command[64];
+    snprintf(command, sizeof(command), "rm -rf %s", _directory);
+    system(command);
+
+    printf("%s\n", _failures == 0 ? "all checks passed" : "checks failed");
+    return _failures == 0 ? 0 : 1;
+}